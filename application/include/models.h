@@ -0,0 +1,168 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MODELS_H_INCLUDED
+#define MODELS_H_INCLUDED
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+// A model descriptor holds what the application knows about a network at compile
+// time: the size of its input, its outputs and how to decode them. The functions
+// at the end of this file are templates over the descriptor, so the preprocessing
+// and decoding are compiled for each model with its sizes as constants.
+//
+// A new classifier only needs a descriptor with its input width and height and a
+// Class enum ending in CLASSES; classify<NewModel>() does the rest.
+
+// FaceDetectionModel describes face-detection-adas-0001
+struct FaceDetectionModel
+{
+    static constexpr int width = 672;
+    static constexpr int height = 384;
+
+    // every detection is [image_id, label, confidence, x_min, y_min, x_max, y_max],
+    // with coordinates relative to the input image
+    static constexpr int detectionSize = 7;
+    static constexpr int confidence = 2;
+    static constexpr int xMin = 3;
+    static constexpr int yMin = 4;
+    static constexpr int xMax = 5;
+    static constexpr int yMax = 6;
+
+    // decode appends the detections of prob above threshold, in the coordinates of
+    // the region of the frame the input image was taken from
+    static void decode(const cv::Mat& prob, const cv::Rect& region, float threshold,
+                       std::vector<cv::Rect>& boxes, std::vector<float>& scores)
+    {
+        const float* data = reinterpret_cast<const float*>(prob.data);
+        for (size_t i = 0; i + detectionSize <= prob.total(); i += detectionSize)
+        {
+            const float* d = data + i;
+            if (d[confidence] > threshold)
+            {
+                int left = region.x + (int)(d[xMin] * region.width);
+                int top = region.y + (int)(d[yMin] * region.height);
+                int right = region.x + (int)(d[xMax] * region.width);
+                int bottom = region.y + (int)(d[yMax] * region.height);
+
+                boxes.push_back(cv::Rect(left, top, right - left + 1, bottom - top + 1));
+                scores.push_back(d[confidence]);
+            }
+        }
+    }
+};
+
+// HeadPoseModel describes head-pose-estimation-adas-0001
+struct HeadPoseModel
+{
+    static constexpr int width = 60;
+    static constexpr int height = 60;
+
+    // outputs, in the order of outputNames()
+    enum Output { YAW, PITCH, ROLL, OUTPUTS };
+
+    // the operator is watching if their head is tilted within a 45 degree angle
+    // relative to the machine, both in yaw and in pitch
+    static constexpr float watchingAngle = 22.5f;
+
+    static const std::vector<cv::String>& outputNames()
+    {
+        static const std::vector<cv::String> names{"angle_y_fc", "angle_p_fc", "angle_r_fc"};
+        return names;
+    }
+
+    static bool watching(const std::vector<cv::Mat>& outs)
+    {
+        float yaw = outs[YAW].at<float>(0);
+        float pitch = outs[PITCH].at<float>(0);
+
+        return yaw > -watchingAngle && yaw < watchingAngle &&
+               pitch > -watchingAngle && pitch < watchingAngle;
+    }
+};
+
+// EmotionsModel describes emotions-recognition-retail-0003
+struct EmotionsModel
+{
+    static constexpr int width = 64;
+    static constexpr int height = 64;
+
+    enum Class { NEUTRAL, HAPPY, SAD, SURPRISE, ANGER, CLASSES };
+};
+
+// preprocess converts an image to a 4d input blob of the size the Model expects
+template <typename Model>
+inline void preprocess(const cv::Mat& image, cv::Mat& blob)
+{
+    cv::dnn::blobFromImage(image, blob, 1.0, cv::Size(Model::width, Model::height));
+}
+
+// detectRegion runs a detector Model over a region of an image, and appends the
+// detections above threshold in image coordinates
+template <typename Model>
+inline void detectRegion(cv::dnn::Net& net, cv::Mat& blob, const cv::Mat& image, const cv::Rect& region,
+                         float threshold, std::vector<cv::Rect>& boxes, std::vector<float>& scores)
+{
+    preprocess<Model>(image(region), blob);
+    net.setInput(blob);
+    Model::decode(net.forward(), region, threshold, boxes, scores);
+}
+
+// estimate runs a Model with several outputs over an image, and returns its
+// outputs in the order of Model::outputNames()
+template <typename Model>
+inline void estimate(cv::dnn::Net& net, cv::Mat& blob, const cv::Mat& image, std::vector<cv::Mat>& outs)
+{
+    preprocess<Model>(image, blob);
+    net.setInput(blob);
+    net.forward(outs, Model::outputNames());
+}
+
+// classify runs a classifier Model over an image, and returns the most likely
+// class, or -1 when its confidence is not above threshold
+template <typename Model>
+inline int classify(cv::dnn::Net& net, cv::Mat& blob, const cv::Mat& image, float threshold)
+{
+    preprocess<Model>(image, blob);
+    net.setInput(blob);
+    cv::Mat prob = net.forward();
+
+    // the output is [1, CLASSES, 1, 1]
+    CV_Assert(prob.total() >= size_t(Model::CLASSES));
+    const float* scores = reinterpret_cast<const float*>(prob.data);
+    int best = 0;
+    for (int i = 1; i < Model::CLASSES; i++)
+    {
+        if (scores[i] > scores[best])
+        {
+            best = i;
+        }
+    }
+
+    return scores[best] > threshold ? best : -1;
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SHMRING_H_INCLUDED
+#define SHMRING_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#define SHMRING_MAGIC 0x524d4f4d
+#define SHMRING_VERSION 1
+
+// The ring is shared between processes, so its atomics must not hide a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory ring needs lock-free atomics");
+
+// ShmRingHeader is at the start of the shared memory object, followed by the
+// frame slots. Frame n (counting from 1) is written to slot (n - 1) % slots.
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t width;
+    uint32_t height;
+    uint32_t type;           // OpenCV type of the frames, always CV_8UC3
+    uint32_t stride;         // bytes per row of a frame
+    uint32_t fps_milli;      // frame rate of the source, in frames per 1000 seconds
+    uint64_t slot_size;      // bytes per slot, including its ShmSlotHeader
+    uint64_t data_offset;    // offset of the first slot from the start of the object
+    std::atomic<uint64_t> written;  // number of the last complete frame, 0 if none yet
+    std::atomic<uint32_t> notify;   // futex word, bumped on every frame
+    std::atomic<uint32_t> closed;   // set by the producer when it stops
+};
+
+// ShmSlotHeader precedes the pixels in every slot. seq is 0 while the producer
+// writes the slot, and the number of the frame it holds once it is complete.
+struct ShmSlotHeader
+{
+    std::atomic<uint64_t> seq;
+    uint64_t timestamp_ns;   // CLOCK_MONOTONIC time the frame was captured
+};
+
+// ShmRingWriter publishes frames into a shared memory ring.
+class ShmRingWriter
+{
+public:
+    ShmRingWriter();
+    ~ShmRingWriter();
+
+    bool create(const std::string& name, int width, int height, int type, int slots, double fps);
+    bool write(const cv::Mat& frame);
+    void close();
+
+private:
+    std::string name;
+    ShmRingHeader* header;
+    size_t size;
+};
+
+// ShmRingReader reads frames from a shared memory ring without copying them.
+class ShmRingReader
+{
+public:
+    ShmRingReader();
+    ~ShmRingReader();
+
+    bool open(const std::string& name);
+    bool isOpened() const;
+    bool read(cv::Mat& frame, uint64_t& seq, uint64_t& timestamp_ns, int timeoutMs);
+    bool valid(uint64_t seq) const;
+
+private:
+    ShmSlotHeader* slot(uint64_t seq) const;
+
+    ShmRingHeader* header;
+    size_t size;
+    uint64_t last;
+};
+
+#endif
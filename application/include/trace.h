@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Tracing records how long every stage of the pipeline takes for every frame.
+// Each thread records into its own fixed-size ring buffer, keeping its most
+// recent events, and trace_write exports them all as Chrome trace JSON, which
+// can be opened in Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+// Until trace_start is called, recording an event costs a single atomic load.
+
+extern std::atomic<bool> trace_on;
+
+void trace_start(size_t eventsPerThread);
+void trace_thread_name(const char* name);
+void trace_event(const char* name, int stream, long frame, int64_t start, int64_t end);
+void trace_wait(const char* name, int stream, long frame, int64_t start, int64_t end);
+bool trace_write(const std::string& path);
+
+inline bool trace_enabled()
+{
+    return trace_on.load(std::memory_order_relaxed);
+}
+
+// trace_time converts a steady clock time to the time base of the trace, in nanoseconds
+inline int64_t trace_time(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+inline int64_t trace_now()
+{
+    return trace_time(std::chrono::steady_clock::now());
+}
+
+// TraceScope records an event lasting from its construction to its destruction.
+// stream and frame identify the frame it belongs to, or are -1.
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name, int stream = -1, long frame = -1)
+        : name(name), stream(stream), frame(frame), start(trace_enabled() ? trace_now() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (start != 0 && trace_enabled())
+        {
+            trace_event(name, stream, frame, start, trace_now());
+        }
+    }
+
+private:
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+
+    const char* name;
+    int stream;
+    long frame;
+    int64_t start;
+};
+
+#endif
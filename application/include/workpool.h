@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef WORKPOOL_H_INCLUDED
+#define WORKPOOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Task is a unit of work for the pool. It receives the index of the worker that
+// runs it, so it can use resources owned by that worker such as its own Net.
+typedef std::function<void(size_t)> Task;
+
+// WorkPool is a work-stealing thread pool. Every worker owns a task deque and
+// takes work from it first; an idle worker steals from the other deques.
+class WorkPool
+{
+public:
+    explicit WorkPool(size_t workers);
+    ~WorkPool();
+
+    size_t size() const;
+    void submit(Task task);
+    void run(std::vector<Task>& tasks, size_t worker);
+    void stop();
+
+private:
+    struct Deque
+    {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    void push(size_t worker, Task task);
+    bool pop(size_t worker, Task& task);
+    void loop(size_t worker);
+
+    std::vector<std::unique_ptr<Deque>> deques;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next;
+    std::atomic<size_t> queued;
+    std::atomic<bool> running;
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+#endif
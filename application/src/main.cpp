@@ -28,8 +28,10 @@
 #include <queue>
 #include <map>
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <ctime>
+#include <memory>
 #include <mutex>
 #include <syslog.h>
 #include <string>
@@ -46,6 +48,18 @@
 // MQTT
 #include "mqtt.h"
 
+// inference thread pool
+#include "workpool.h"
+
+// shared memory frame ingest
+#include "shmring.h"
+
+// network descriptors
+#include "models.h"
+
+// per-frame latency tracing
+#include "trace.h"
+
 using namespace std;
 using namespace cv;
 using namespace dnn;
@@ -53,13 +67,22 @@ using namespace dnn;
 using json = nlohmann::json;
 json jsonobj;
 
+typedef chrono::steady_clock::time_point TimePoint;
+
 // OpenCV-related variables
-Mat frame, blob, moodBlob, poseBlob;
-VideoCapture cap;
 int delay = 5;
-Net net, moodnet, posenet;
-bool moodChecked = false;
-bool poseChecked = false;
+
+// Engine holds one instance of each network. Net is not thread-safe, so every
+// inference worker owns an Engine and only ever runs its own networks.
+struct Engine
+{
+    Net net, moodnet, posenet;
+    Mat blob, moodBlob, poseBlob;
+    bool moodChecked;
+    bool poseChecked;
+};
+
+vector<Engine> engines;
 
 // application parameters
 String model;
@@ -73,11 +96,16 @@ int targetId;
 int rate;
 float confidenceFace;
 float confidenceMood;
+float confidenceCandidate;
+float motionThreshold;
+float staleness;
+float urgentFps;
+float normalFps;
+float idleFps;
+size_t workers;
 
 // flags related to mood monitoring
 int angry_timeout;
-bool prev_angry = false;
-clock_t begin_angry, end_angry;
 
 // flag to control background threads
 atomic<bool> keepRunning(true);
@@ -96,18 +124,99 @@ struct WorkerInfo
     bool alert;
 };
 
-// currentInfo contains the latest WorkerInfo tracked by the application.
-WorkerInfo currentInfo = {
-  false,
-  false,
-  false,
+// DetectMode selects how faces are searched for in the frames of a stream
+enum DetectMode
+{
+    DETECT_FULL,    // a single pass over the frame scaled down to the face network input
+    DETECT_CASCADE, // full pass, then full resolution passes around weak candidates only
+    DETECT_TILED    // full pass, plus full resolution passes over a grid of tiles in parallel
+};
+
+// Priority ranks the streams for inference when the workers can not keep up
+enum Priority
+{
+    PRIORITY_URGENT, // the operator is angry or not watching the machine
+    PRIORITY_NORMAL, // the operator is watching the machine calmly
+    PRIORITY_IDLE    // nobody in view
 };
 
-// nextImage provides queue for captured video frames
-queue<Mat> nextImage;
+// Detection contains what the networks found in a single frame, and what it cost.
+// A skipped frame did not go through the networks and keeps the last detection.
+struct Detection
+{
+    int faces;
+    bool watching;
+    bool angry;
+    int passes;
+    double ms;
+    bool skipped;
+};
+
+// FrameJob is a captured frame waiting for inference. seq numbers the frames
+// of a stream in capture order. shmSeq is the number of the frame in the shared
+// memory ring it is read from, or 0. thumbnail is the downsampled frame used to
+// detect motion, once the frame is sent to inference.
+struct FrameJob
+{
+    Mat image;
+    long seq;
+    TimePoint captured;
+    uint64_t shmSeq;
+    Mat thumbnail;
+};
+
+// Stream contains the video source and the operator state for one of the inputs
+// listed in the config file.
+struct Stream
+{
+    int id;
+    VideoCapture cap;
+    unique_ptr<ShmRingReader> shm;
+    String window;
+    DetectMode mode;
+
+    // nextImage provides queue for captured video frames
+    queue<FrameJob> nextImage;
+    long captured;
+
+    // results holds detections that finished ahead of an earlier frame of the
+    // stream; they are merged once all the frames before them are merged
+    map<long, pair<FrameJob, Detection>> results;
+    long merged;
+
+    // currentInfo contains the latest WorkerInfo tracked for the stream, and
+    // last the latest detection that went through the networks
+    WorkerInfo currentInfo;
+    Detection last;
+    bool prev_angry;
+    TimePoint begin_angry;
+    Priority priority;
+
+    // lastDispatched is when a frame of the stream was last handed to the pool
+    TimePoint lastDispatched;
+
+    // reference is the downsampled last frame whose detection was merged
+    Mat reference;
+    TimePoint lastInferred;
+
+    // frames handed over to inference, and how many of them were skipped
+    atomic<long> seen;
+    atomic<long> skipped;
+    long publishedSeen;
+    long publishedSkipped;
+
+    mutex m, m2;
+};
+
+vector<unique_ptr<Stream>> streams;
+
+// pool runs the inference for frames of all the streams
+unique_ptr<WorkPool> pool;
+atomic<size_t> inFlight(0);
+
 String currentPerf;
 
-mutex m, m1, m2;
+mutex m1;
 
 // TODO: configure time limit for ANGRY and watching
 const char* keys =
@@ -117,6 +226,9 @@ const char* keys =
     "{ config c    | | Path to .xml file of model containing network configuration. }"
     "{ faceconf fc  | 0.5 | Confidence factor for face detection required. }"
     "{ moodconf mc  | 0.5 | Confidence factor for emotion detection required. }"
+    "{ candconf cc  | 0.2 | Confidence factor for a face candidate to be searched again at full resolution in cascade mode. }"
+    "{ motion mo   | 0.005 | fraction of pixels that must change since the last inference for a frame to be inferred, 0 to infer every frame. }"
+    "{ stale st    | 1 | maximum number of seconds the last inference is reused for unchanged frames. }"
     "{ sentmodel sm     | | Path to .bin file of sentiment model. }"
     "{ sentconfig sc    | | Path to a .xml file of sentimen model containing network configuration. }"
     "{ posemodel pm     | | Path to .bin file of head pose model. }"
@@ -132,56 +244,124 @@ const char* keys =
                         "2: OpenCL fp16 (half-float precision), "
                         "3: VPU }"
     "{ rate r      | 1 | number of seconds between data updates to MQTT server. }"
-    "{ angry a     | 5 | number of seconds during which the operator has been angrily operating the machine. }";
+    "{ angry a     | 5 | number of seconds during which the operator has been angrily operating the machine. }"
+    "{ urgentfps uf | 10 | frames per second due to an input where the operator is angry or not watching the machine. }"
+    "{ normalfps nf | 5 | frames per second due to an input where the operator is calmly watching the machine. }"
+    "{ idlefps idf | 1 | maximum frames per second inferred for an input with nobody in view. }"
+    "{ workers w   | 1 | number of inference worker threads, each with its own copy of the networks. }"
+    "{ trace       |   | path of a Chrome trace JSON file to record the time of every stage for every frame to, for Perfetto. }"
+    "{ bench       |   | measure inference throughput on the first input with 1 up to --workers workers, then exit. }";
+
+
+// nextImageAvailable takes the next image of the stream from the queue in a thread-safe way
+bool nextImageAvailable(Stream& s, FrameJob& job) {
+    bool rtn = false;
+    s.m.lock();
+    if (!s.nextImage.empty()) {
+        job = s.nextImage.front();
+        s.nextImage.pop();
+        rtn = true;
+    }
+    s.m.unlock();
 
+    return rtn;
+}
 
-// nextImageAvailable returns the next image from the queue in a thread-safe way
-Mat nextImageAvailable() {
-    Mat rtn;
-    m.lock();
-    if (!nextImage.empty()) {
-        rtn = nextImage.front();
-        nextImage.pop();
-    }
-    m.unlock();
+// hasImage tells if the stream has an image in the queue in a thread-safe way
+bool hasImage(Stream& s) {
+    s.m.lock();
+    bool rtn = !s.nextImage.empty();
+    s.m.unlock();
 
     return rtn;
 }
 
-// addImage adds an image to the queue in a thread-safe way
-void addImage(Mat img) {
-    m.lock();
-    if (nextImage.empty()) {
-        nextImage.push(img);
+// addImage adds an image to the queue of the stream in a thread-safe way. An image
+// still waiting in the queue is replaced by the newer one, keeping its sequence number.
+// It returns the sequence number of the queued image.
+long addImage(Stream& s, Mat img, TimePoint captured, uint64_t shmSeq) {
+    s.m.lock();
+    if (s.nextImage.empty()) {
+        FrameJob job;
+        job.seq = s.captured++;
+        s.nextImage.push(job);
     }
-    m.unlock();
+    s.nextImage.back().image = img;
+    s.nextImage.back().captured = captured;
+    s.nextImage.back().shmSeq = shmSeq;
+    long seq = s.nextImage.back().seq;
+    s.m.unlock();
+
+    return seq;
 }
 
-// getCurrentInfo returns the most-recent WorkerInfo for the application.
-WorkerInfo getCurrentInfo() {
-    m2.lock();
+// readFrame reads the next frame of the stream from its video source, or from its
+// shared memory ring without copying it, and sets captured to its capture time.
+// frame is left empty when the ring has no new frame yet. It returns false once
+// the stream has ended.
+bool readFrame(Stream& s, Mat& frame, TimePoint& captured, uint64_t& seq) {
+    if (s.shm) {
+        // the producer stamps frames with CLOCK_MONOTONIC, which steady_clock uses on Linux
+        uint64_t timestamp = 0;
+        bool rtn = s.shm->read(frame, seq, timestamp, 100);
+        captured = TimePoint(chrono::duration_cast<chrono::steady_clock::duration>(chrono::nanoseconds(timestamp)));
+
+        return rtn;
+    }
+
+    seq = 0;
+    s.cap.read(frame);
+    captured = chrono::steady_clock::now();
+
+    return !frame.empty();
+}
+
+// getCurrentInfo returns the most-recent WorkerInfo for the stream.
+WorkerInfo getCurrentInfo(Stream& s) {
+    s.m2.lock();
     WorkerInfo rtn;
-    rtn = currentInfo;
-    m2.unlock();
+    rtn = s.currentInfo;
+    s.m2.unlock();
 
     return rtn;
 }
 
-// updateInfo uppdates the current WorkerInfo for the application to the latest detected values
-void updateInfo(WorkerInfo info) {
-    m2.lock();
-    currentInfo.watching = info.watching;
-    currentInfo.angry = info.angry;
-    currentInfo.alert = info.alert;
-    m2.unlock();
+// updateInfo uppdates the current WorkerInfo for the stream to the latest detected values.
+// Must be called with s.m2 held.
+void updateInfo(Stream& s, WorkerInfo info) {
+    s.currentInfo.watching = info.watching;
+    s.currentInfo.angry = info.angry;
+    s.currentInfo.alert = info.alert;
 }
 
-// resetInfo resets the current WorkerInfo for the application.
-void resetInfo() {
-    m2.lock();
-    currentInfo.watching = false;
-    currentInfo.angry = false;
-    m2.unlock();
+// resetInfo resets the current WorkerInfo for the stream.
+void resetInfo(Stream& s) {
+    s.m2.lock();
+    s.currentInfo.watching = false;
+    s.currentInfo.angry = false;
+    s.m2.unlock();
+}
+
+// getCurrentCost returns the most-recent Detection that went through the networks for the stream.
+Detection getCurrentCost(Stream& s) {
+    s.m2.lock();
+    Detection rtn;
+    rtn = s.last;
+    s.m2.unlock();
+
+    return rtn;
+}
+
+// getSkipRatio returns the fraction of the frames of the stream that skipped inference
+// since the given counts, and moves the counts forward.
+double getSkipRatio(Stream& s, long& seen, long& skipped) {
+    long nowSkipped = s.skipped.load();
+    long nowSeen = s.seen.load();
+    double ratio = nowSeen > seen ? double(nowSkipped - skipped) / (nowSeen - seen) : 0;
+    seen = nowSeen;
+    skipped = nowSkipped;
+
+    return ratio;
 }
 
 // getCurrentPerf returns a display string with the most current performance stats for the Inference Engine.
@@ -195,38 +375,41 @@ string getCurrentPerf() {
 }
 
 // savePerformanceInfo sets the display string with the most current performance stats for the Inference Engine.
-void savePerformanceInfo() {
-    m1.lock();
-
+void savePerformanceInfo(Engine& e) {
     vector<double> faceTimes, moodTimes, poseTimes;
     double freq = getTickFrequency() / 1000;
-    double t = net.getPerfProfile(faceTimes) / freq;
-    double t2, t3;
+    double t = e.net.getPerfProfile(faceTimes) / freq;
+    double t2 = 0, t3 = 0;
 
-    if (moodChecked) {
-        t2 = moodnet.getPerfProfile(moodTimes) / freq;
+    if (e.moodChecked) {
+        t2 = e.moodnet.getPerfProfile(moodTimes) / freq;
     }
 
-    if (poseChecked) {
-        t3 = posenet.getPerfProfile(poseTimes) / freq;
+    if (e.poseChecked) {
+        t3 = e.posenet.getPerfProfile(poseTimes) / freq;
     }
 
     string label = format("Face inference time: %.2f ms, Mood inference time: %.2f ms, Pose inference time: %.2f ms", t, t2, t3);
 
+    m1.lock();
     currentPerf = label;
-
     m1.unlock();
 }
 
 // publish MQTT message with a JSON payload
-void publishMQTTMessage(const string& topic, const WorkerInfo& info)
+void publishMQTTMessage(const string& topic, int stream, const WorkerInfo& info, double skipRatio)
 {
     ostringstream s;
-    s << "{\"watching\": \"" << info.watching << "\",";
-    s << "\"angry\": \"" << info.angry << "\"}";
+    s << "{\"stream\": \"" << stream << "\",";
+    s << "\"watching\": \"" << info.watching << "\",";
+    s << "\"angry\": \"" << info.angry << "\",";
+    s << "\"skip_ratio\": \"" << skipRatio << "\"}";
     string payload = s.str();
 
-    mqtt_publish(topic, payload);
+    {
+        TraceScope scope("mqtt_publish", stream);
+        mqtt_publish(topic, payload);
+    }
 
     string msg = "MQTT message published to topic: " + topic;
     syslog(LOG_INFO, "%s", msg.c_str());
@@ -243,126 +426,540 @@ int handleMQTTControlMessages(void *context, char *topicName, int topicLen, MQTT
     return 1;
 }
 
-// Function called by worker thread to process the next available video frame.
-void frameRunner() {
-    while (keepRunning.load()) {
-        Mat next = nextImageAvailable();
-        if (!next.empty()) {
-            // convert to 4d vector as required by face detection model, and detect faces
-            blobFromImage(next, blob, 1.0, Size(672, 384));
-            net.setInput(blob);
-            Mat prob = net.forward();
-
-            // get faces
-            vector<Rect> faces;
-            // machine operator flags
-            bool watching = false;
-            bool angry = false;
-            bool alert = false;
-            float* data = (float*)prob.data;
-            for (size_t i = 0; i < prob.total(); i += 7)
-            {
-                float confidence = data[i + 2];
-                if (confidence > confidenceFace)
-                {
-                    int left = (int)(data[i + 3] * frame.cols);
-                    int top = (int)(data[i + 4] * frame.rows);
-                    int right = (int)(data[i + 5] * frame.cols);
-                    int bottom = (int)(data[i + 6] * frame.rows);
-                    int width = right - left + 1;
-                    int height = bottom - top + 1;
-
-                    faces.push_back(Rect(left, top, width, height));
-                }
+// detectFaces runs the face network of the engine over a region of the frame, and
+// appends the faces found above threshold in frame coordinates.
+void detectFaces(Engine& e, const Mat& img, const Rect& region, float threshold,
+                 vector<Rect>& boxes, vector<float>& scores) {
+    detectRegion<FaceDetectionModel>(e.net, e.blob, img, region, threshold, boxes, scores);
+}
+
+// tileRegions splits a frame into tiles of the size of the face network input,
+// overlapping by a tenth, so small faces are seen at full resolution. A frame no
+// larger than the network input has no tiles.
+vector<Rect> tileRegions(Size frame) {
+    const Size tile(FaceDetectionModel::width, FaceDetectionModel::height);
+    vector<Rect> tiles;
+    if (frame.width <= tile.width && frame.height <= tile.height) {
+        return tiles;
+    }
+
+    for (int y = 0; ; y += tile.height * 9 / 10) {
+        int top = min(y, max(frame.height - tile.height, 0));
+        for (int x = 0; ; x += tile.width * 9 / 10) {
+            int left = min(x, max(frame.width - tile.width, 0));
+            tiles.push_back(Rect(left, top, tile.width, tile.height) & Rect(0, 0, frame.width, frame.height));
+            if (left + tile.width >= frame.width) {
+                break;
             }
+        }
+        if (top + tile.height >= frame.height) {
+            break;
+        }
+    }
 
-            // detect if the operator is watching at the machine
-            for(auto const& r: faces) {
-                // make sure the face rect is completely inside the main Mat
-                if ((r & Rect(0, 0, next.cols, next.rows)) != r) {
-                    continue;
-                }
+    return tiles;
+}
 
-                // Read detected face
-                Mat face = next(r);
-
-                // posenet output and list of output layers that contain the inference data
-                std::vector<Mat> outs;
-                std::vector<String> names{"angle_y_fc", "angle_p_fc", "angle_r_fc"};
-
-                // convert to 4d vector, and process through neural network
-                blobFromImage(face, poseBlob, 1.0, Size(60, 60));
-                posenet.setInput(poseBlob);
-                posenet.forward(outs, names);
-                poseChecked = true;
-
-                // convert to 4d vector, and propagate through sentiment Neural Network
-                blobFromImage(face, moodBlob, 1.0, Size(64, 64));
-                moodnet.setInput(moodBlob);
-                Mat prob = moodnet.forward();
-                moodChecked = true;
-
-                // the operator is watching if their head is tilted within a 45 degree angle relative to the shelf
-                if ( (outs[0].at<float>(0) > -22.5) && (outs[0].at<float>(0) < 22.5) &&
-                     (outs[1].at<float>(0) > -22.5) && (outs[1].at<float>(0) < 22.5) ) {
-                     watching = true;
-                }
+// candidateRegion returns the full resolution region searched around a weak face
+// candidate: an area the size of the network input, or twice the candidate for
+// large ones, centred on the candidate and kept inside the frame.
+Rect candidateRegion(const Rect& r, Size frame) {
+    const int inputWidth = FaceDetectionModel::width;
+    const int inputHeight = FaceDetectionModel::height;
+    int width = max(inputWidth, r.width * 2);
+    int height = max(inputHeight, r.height * 2);
+
+    // keep the aspect ratio of the network input
+    if (width * inputHeight > height * inputWidth) {
+        height = width * inputHeight / inputWidth;
+    } else {
+        width = height * inputWidth / inputHeight;
+    }
 
-                if (watching) {
-                    // flatten the result from [1, 5, 1, 1] to [1, 5]
-                    Mat flat = prob.reshape(1, (prob.rows * prob.cols));
-                    // Find the max in returned list of moods
-                    Point maxLoc;
-                    double confidence;
-                    minMaxLoc(flat, 0, &confidence, 0, &maxLoc);
-                    if (confidence > static_cast<double>(confidenceMood)) {
-                        if (maxLoc.y == 4) {
-                            angry = true;
-                            // if the operator wasn't angry before restart timer
-                            if (!prev_angry) {
-                                begin_angry = clock();
-                            }
-                        }
-                    }
+    int left = max(0, min(r.x + r.width / 2 - width / 2, frame.width - width));
+    int top = max(0, min(r.y + r.height / 2 - height / 2, frame.height - height));
+
+    return Rect(left, top, width, height) & Rect(0, 0, frame.width, frame.height);
+}
+
+// findFaces searches the frame for faces as selected by mode. Full resolution
+// passes are spread over the pool when one is given. passes is set to the number
+// of face network passes it took.
+vector<Rect> findFaces(Engine& e, size_t worker, WorkPool* tiles, const Mat& img, DetectMode mode, int& passes,
+                       int stream, long frame) {
+    Rect all(0, 0, img.cols, img.rows);
+    vector<Rect> boxes;
+    vector<float> scores;
+
+    if (mode == DETECT_FULL) {
+        detectFaces(e, img, all, confidenceFace, boxes, scores);
+        passes = 1;
+        return boxes;
+    }
+
+    vector<Rect> regions;
+    if (mode == DETECT_CASCADE) {
+        // cheap pass: keep the confident faces, and look again at full
+        // resolution around the ones the scaled down frame left in doubt
+        vector<Rect> candidates;
+        vector<float> candidateScores;
+        detectFaces(e, img, all, confidenceCandidate, candidates, candidateScores);
+
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (candidateScores[i] > confidenceFace) {
+                boxes.push_back(candidates[i]);
+                scores.push_back(candidateScores[i]);
+                continue;
+            }
+
+            Rect c = candidates[i] & all;
+            bool covered = false;
+            for (auto const& region : regions) {
+                if ((c & region) == c) {
+                    covered = true;
+                    break;
                 }
             }
+            if (!covered) {
+                regions.push_back(candidateRegion(c, img.size()));
+            }
+        }
+    } else {
+        // the full pass still finds the large faces that are cut by the tiles
+        detectFaces(e, img, all, confidenceFace, boxes, scores);
+        regions = tileRegions(img.size());
+    }
+
+    passes = 1 + regions.size();
+
+    mutex found;
+    vector<Task> tasks;
+    for (auto const& region : regions) {
+        tasks.push_back([&, region](size_t w) {
+            TraceScope scope("face detection tile", stream, frame);
+            vector<Rect> b;
+            vector<float> sc;
+            detectFaces(engines[w], img, region, confidenceFace, b, sc);
+
+            lock_guard<mutex> lock(found);
+            boxes.insert(boxes.end(), b.begin(), b.end());
+            scores.insert(scores.end(), sc.begin(), sc.end());
+        });
+    }
+
+    if (tiles != nullptr) {
+        tiles->run(tasks, worker);
+    } else {
+        for (auto& t : tasks) {
+            t(worker);
+        }
+    }
+
+    // the same face is found by overlapping passes
+    vector<int> keep;
+    NMSBoxes(boxes, scores, confidenceFace, 0.4f, keep);
+
+    vector<Rect> faces;
+    for (int i : keep) {
+        faces.push_back(boxes[i]);
+    }
+
+    return faces;
+}
+
+// detect runs the networks over a video frame on the engine of the given worker.
+// stream and frame identify the frame in the trace.
+Detection detect(size_t worker, WorkPool* tiles, const Mat& next, DetectMode mode, int stream, long frame) {
+    Engine& e = engines[worker];
+    int64 start = getTickCount();
+
+    // get faces
+    int passes = 0;
+    vector<Rect> faces;
+    {
+        TraceScope scope("face detection", stream, frame);
+        faces = findFaces(e, worker, tiles, next, mode, passes, stream, frame);
+    }
+    // machine operator flags
+    bool watching = false;
+    bool angry = false;
+
+    // detect if the operator is watching at the machine
+    for(auto const& r: faces) {
+        // make sure the face rect is completely inside the main Mat
+        if ((r & Rect(0, 0, next.cols, next.rows)) != r) {
+            continue;
+        }
+
+        // Read detected face
+        Mat face = next(r);
+
+        // process the face through the head pose neural network
+        std::vector<Mat> outs;
+        {
+            TraceScope scope("head pose", stream, frame);
+            estimate<HeadPoseModel>(e.posenet, e.poseBlob, face, outs);
+        }
+        e.poseChecked = true;
+
+        if (HeadPoseModel::watching(outs)) {
+            watching = true;
+        }
+
+        // the mood only matters while the operator is watching, so the sentiment
+        // neural network is only run then
+        if (watching) {
+            TraceScope scope("emotion", stream, frame);
+            int mood = classify<EmotionsModel>(e.moodnet, e.moodBlob, face, confidenceMood);
+            e.moodChecked = true;
+            if (mood == EmotionsModel::ANGER) {
+                angry = true;
+            }
+        }
+    }
+
+    Detection d;
+    d.faces = faces.size();
+    d.watching = watching;
+    d.angry = angry;
+    d.passes = passes;
+    d.ms = (getTickCount() - start) / getTickFrequency() * 1000;
+    d.skipped = false;
+
+    return d;
+}
+
+// applyDetection updates the operator state of the stream with the detection
+// for a frame. Must be called with s.m2 held and in frame order.
+void applyDetection(Stream& s, const FrameJob& job, Detection d) {
+    TimePoint captured = job.captured;
+
+    // an unchanged frame keeps the operator state of the last inferred one, but
+    // still moves the angry timer forward
+    if (d.skipped) {
+        d = s.last;
+    } else {
+        s.last = d;
+
+        // later frames are compared with this one only now that it has a detection
+        if (!job.thumbnail.empty()) {
+            s.reference = job.thumbnail;
+            s.lastInferred = captured;
+        }
+    }
+
+    // if the operator wasn't angry before restart timer
+    if (d.angry && !s.prev_angry) {
+        s.begin_angry = captured;
+    }
+
+    // operator data
+    WorkerInfo info;
+    info.watching = d.watching;
+    info.angry = d.angry;
+    info.alert = false;
+
+    if (d.watching && d.angry) {
+        double elapsed_secs = chrono::duration<double>(captured - s.begin_angry).count();
+        if (elapsed_secs > static_cast<double>(angry_timeout)) {
+            info.alert = true;
+        }
+    }
+
+    updateInfo(s, info);
+
+    if (d.angry || (d.faces > 0 && !d.watching)) {
+        s.priority = PRIORITY_URGENT;
+    } else if (d.faces > 0) {
+        s.priority = PRIORITY_NORMAL;
+    } else {
+        s.priority = PRIORITY_IDLE;
+    }
+
+    // remember previous angry
+    s.prev_angry = d.angry;
+}
+
+// mergeDetection hands the detection for a frame over to its stream. Workers may
+// finish the frames of a stream out of order, so detections are buffered and
+// applied in capture order.
+void mergeDetection(Stream& s, const FrameJob& job, const Detection& d) {
+    s.m2.lock();
+    s.results[job.seq] = make_pair(job, d);
+    auto it = s.results.begin();
+    while (it != s.results.end() && it->first == s.merged) {
+        applyDetection(s, it->second.first, it->second.second);
+        it = s.results.erase(it);
+        s.merged++;
+    }
+    s.m2.unlock();
+}
+
+// sceneChanged tells if a frame differs enough from the last frame of the stream whose
+// detection was merged to be worth inferring. Frames are compared downsampled to
+// grayscale, and are always inferred once the last inference is stale. The
+// downsampled frame is kept in the job, to become the reference once merged.
+bool sceneChanged(Stream& s, FrameJob& job) {
+    if (motionThreshold <= 0) {
+        return true;
+    }
+
+    Mat small, gray, diff;
+    resize(job.image, small, Size(160, 160 * job.image.rows / job.image.cols), 0, 0, INTER_AREA);
+    if (small.channels() == 3) {
+        cvtColor(small, gray, COLOR_BGR2GRAY);
+    } else {
+        gray = small;
+    }
+
+    s.m2.lock();
+    Mat reference = s.reference;
+    TimePoint lastInferred = s.lastInferred;
+    s.m2.unlock();
+
+    bool changed = true;
+    if (!reference.empty() && job.captured - lastInferred < chrono::duration<double>(staleness)) {
+        absdiff(gray, reference, diff);
+        threshold(diff, diff, 25, 255, THRESH_BINARY);
+        changed = countNonZero(diff) > motionThreshold * diff.total();
+    }
+
+    if (changed) {
+        job.thumbnail = gray;
+    }
 
-            // operator data
-            WorkerInfo info;
-            info.watching = watching;
-            info.angry = angry;
-            info.alert = alert;
-
-            if (watching && angry) {
-                end_angry = clock();
-                double elapsed_secs = double(end_angry - begin_angry) / CLOCKS_PER_SEC;
-                if (elapsed_secs > static_cast<double>(angry_timeout)) {
-                    info.alert = true;
+    return changed;
+}
+
+// frameDue sets the priority of the stream and the deadline for its next inference,
+// and tells if the stream may be inferred now: idle streams are held back until
+// their deadline. A pending angry alert brings the deadline forward so it fires on time.
+bool frameDue(Stream& s, TimePoint now, TimePoint& due, Priority& priority) {
+    s.m2.lock();
+    priority = s.priority;
+    bool countdown = s.currentInfo.angry && !s.currentInfo.alert;
+    TimePoint alertAt = s.begin_angry + chrono::duration_cast<chrono::steady_clock::duration>(
+        chrono::duration<double>(angry_timeout));
+    s.m2.unlock();
+
+    float fps = priority == PRIORITY_URGENT ? urgentFps :
+                priority == PRIORITY_NORMAL ? normalFps : idleFps;
+    due = s.lastDispatched;
+    if (fps > 0) {
+        due += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1 / fps));
+    }
+
+    if (countdown && alertAt < due) {
+        due = alertAt;
+    }
+
+    return priority != PRIORITY_IDLE || due <= now;
+}
+
+// nextStream picks, among the streams with an image waiting, the one to infer next.
+// Streams whose deadline has passed go first, the most urgent priority first and the
+// earliest deadline among equals, so urgent streams keep their rate under overload.
+// When none is overdue, the earliest deadline goes. It returns nullptr when no stream
+// may be inferred now.
+Stream* nextStream(TimePoint now) {
+    Stream* rtn = nullptr;
+    TimePoint earliest;
+    Priority rank = PRIORITY_IDLE;
+    bool overdue = false;
+    for (auto& s : streams) {
+        TimePoint due;
+        Priority priority;
+        if (!hasImage(*s) || !frameDue(*s, now, due, priority)) {
+            continue;
+        }
+
+        bool late = due <= now;
+        if (rtn != nullptr) {
+            if (late != overdue) {
+                if (!late) {
+                    continue;
                 }
+            } else if (late && priority != rank) {
+                if (priority > rank) {
+                    continue;
+                }
+            } else if (due >= earliest) {
+                continue;
             }
+        }
 
-            updateInfo(info);
-            savePerformanceInfo();
+        rtn = s.get();
+        earliest = due;
+        rank = priority;
+        overdue = late;
+    }
 
-            // remember previous angry
-            prev_angry = angry;
+    return rtn;
+}
+
+// Function called by worker thread to hand the next available video frames over to the inference pool,
+// earliest deadline first.
+void frameRunner() {
+    trace_thread_name("frameRunner");
+
+    while (keepRunning.load()) {
+        // keep at most one frame per worker in flight, so frames are dropped
+        // at capture rather than queued up behind the pool
+        Stream* stream = nullptr;
+        if (inFlight.load() < pool->size()) {
+            stream = nextStream(chrono::steady_clock::now());
+        }
+
+        FrameJob job;
+        if (stream == nullptr || !nextImageAvailable(*stream, job)) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+
+        // the time the frame waited in nextImage
+        if (trace_enabled()) {
+            trace_wait("queued", stream->id, job.seq, trace_time(job.captured), trace_now());
+        }
+
+        stream->seen++;
+
+        // on a static scene keep the last detection instead
+        bool changed;
+        {
+            TraceScope scope("motion check", stream->id, job.seq);
+            changed = sceneChanged(*stream, job);
+        }
+
+        if (!changed) {
+            stream->skipped++;
+            Detection d = Detection();
+            d.skipped = true;
+            mergeDetection(*stream, job, d);
+            continue;
         }
+
+        TimePoint dispatched = chrono::steady_clock::now();
+        stream->lastDispatched = dispatched;
+        inFlight++;
+        pool->submit([stream, job, dispatched](size_t worker) {
+            trace_thread_name("inference worker");
+
+            // the time the frame waited for a free worker
+            if (trace_enabled()) {
+                trace_wait("pool wait", stream->id, job.seq, trace_time(dispatched), trace_now());
+            }
+
+            Detection d;
+            {
+                TraceScope scope("inference", stream->id, job.seq);
+                d = detect(worker, pool.get(), job.image, stream->mode, stream->id, job.seq);
+            }
+            savePerformanceInfo(engines[worker]);
+
+            // the producer overwrote the frame while it was inferred
+            if (job.shmSeq != 0 && !stream->shm->valid(job.shmSeq)) {
+                d.skipped = true;
+            }
+
+            {
+                TraceScope scope("merge", stream->id, job.seq);
+                mergeDetection(*stream, job, d);
+            }
+            inFlight--;
+        });
     }
 
+    pool->stop();
+
     cout << "Video processing thread stopped" << endl;
 }
 
 // Function called by worker thread to handle MQTT updates. Pauses for rate second(s) between updates.
 void messageRunner() {
+    trace_thread_name("messageRunner");
+
     while (keepRunning.load()) {
-        WorkerInfo info = getCurrentInfo();
-        publishMQTTMessage(topic, info);
+        for (auto& s : streams) {
+            TraceScope scope("publish", s->id);
+            WorkerInfo info = getCurrentInfo(*s);
+            double skipRatio = getSkipRatio(*s, s->publishedSeen, s->publishedSkipped);
+            publishMQTTMessage(topic, s->id, info, skipRatio);
+        }
         this_thread::sleep_for(chrono::seconds(rate));
     }
 
     cout << "MQTT sender thread stopped" << endl;
 }
 
+// benchmark measures the inference throughput of the pool with 1 up to
+// maxWorkers workers over the first frames of the stream.
+int benchmark(Stream& s, size_t maxWorkers) {
+    const size_t count = 200;
+    vector<Mat> frames;
+    Mat f;
+    TimePoint captured;
+    uint64_t seq;
+    while (frames.size() < count && readFrame(s, f, captured, seq)) {
+        if (!f.empty()) {
+            frames.push_back(f.clone());
+        }
+    }
+
+    if (frames.empty()) {
+        cerr << "ERROR! blank frame grabbed\n";
+        return -1;
+    }
+
+    // the first forward of every network is much slower than the others
+    for (size_t i = 0; i < maxWorkers; i++) {
+        detect(i, nullptr, frames[0], s.mode, s.id, -1);
+    }
+
+    double base = 0;
+    for (size_t n = 1; ; n = min(n * 2, maxWorkers)) {
+        WorkPool bench(n);
+        atomic<size_t> done(0);
+
+        auto start = chrono::steady_clock::now();
+        for (auto const& frame : frames) {
+            bench.submit([&bench, &done, &s, frame](size_t worker) {
+                detect(worker, &bench, frame, s.mode, s.id, -1);
+                done++;
+            });
+        }
+        while (done.load() < frames.size()) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        bench.stop();
+
+        double fps = frames.size() / secs;
+        if (n == 1) {
+            base = fps;
+        }
+        cout << format("workers: %2zu, frames/s: %8.2f, speedup: %5.2fx", n, fps, fps / base) << endl;
+
+        if (n == maxWorkers) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// saveTrace writes the recorded trace, if tracing was asked for
+void saveTrace(const String& path) {
+    if (path.empty()) {
+        return;
+    }
+
+    if (trace_write(path)) {
+        cout << "Trace written to " << path << endl;
+    } else {
+        cerr << "ERROR! Unable to write trace to " << path << "\n";
+    }
+}
+
 // signal handler for the main thread
 void handle_sigterm(int signum)
 {
@@ -392,6 +989,12 @@ int main(int argc, char** argv)
     rate = parser.get<int>("rate");
     confidenceFace = parser.get<float>("faceconf");
     confidenceMood = parser.get<float>("moodconf");
+    confidenceCandidate = parser.get<float>("candconf");
+    motionThreshold = parser.get<float>("motion");
+    staleness = parser.get<float>("stale");
+    urgentFps = parser.get<float>("urgentfps");
+    normalFps = parser.get<float>("normalfps");
+    idleFps = parser.get<float>("idlefps");
 
     angry_timeout = parser.get<int>("angry");
 
@@ -401,12 +1004,13 @@ int main(int argc, char** argv)
     posemodel = parser.get<String>("posemodel");
     poseconfig = parser.get<String>("poseconfig");
 
+    int w = parser.get<int>("workers");
+    workers = w > 0 ? w : 1;
+
     string conf_file = "../resources/config.json";
-    string input;
     std::ifstream confFile(conf_file);
     confFile>>jsonobj;
     auto obj = jsonobj["inputs"];
-    input = obj[0]["video"];
 
     // connect MQTT messaging
     int result = mqtt_start(handleMQTTControlMessages);
@@ -418,78 +1022,184 @@ int main(int argc, char** argv)
 
     mqtt_connect();
 
-    // open face model
-    net = readNet(model, config);
-    net.setPreferableBackend(backendId);
-    net.setPreferableTarget(targetId);
+    // several workers run side by side: let each of them use a single core
+    // instead of all of them competing for every core
+    if (workers > 1) {
+        setNumThreads(1);
+    }
+
+    engines.resize(workers);
+    for (auto& e : engines) {
+        // open face model
+        e.net = readNet(model, config);
+        e.net.setPreferableBackend(backendId);
+        e.net.setPreferableTarget(targetId);
+
+        // open mood model
+        e.moodnet = readNet(sentmodel, sentconfig);
+        e.moodnet.setPreferableBackend(backendId);
+        e.moodnet.setPreferableTarget(targetId);
+
+        // open pose model
+        e.posenet = readNet(posemodel, poseconfig);
+        e.posenet.setPreferableBackend(backendId);
+        e.posenet.setPreferableTarget(targetId);
+
+        e.moodChecked = false;
+        e.poseChecked = false;
+    }
+
+    // open video capture sources
+    for (size_t i = 0; i < obj.size(); i++) {
+        string input = obj[i]["video"];
+        string detection = obj[i].value("detection", "full");
 
-    // open mood model
-    moodnet = readNet(sentmodel, sentconfig);
-    moodnet.setPreferableBackend(backendId);
-    moodnet.setPreferableTarget(targetId);
+        unique_ptr<Stream> s(new Stream());
+        s->id = i;
+        s->window = "Machine Operator Monitor";
+        if (obj.size() > 1) {
+            s->window += format(" %d", s->id);
+        }
+        s->captured = 0;
+        s->merged = 0;
+        s->currentInfo = {false, false, false};
+        s->prev_angry = false;
+        s->last = {0, false, false, 0, 0, false};
+        s->priority = PRIORITY_NORMAL;
+        s->seen = 0;
+        s->skipped = 0;
+        s->publishedSeen = 0;
+        s->publishedSkipped = 0;
+
+        if (detection == "full") {
+            s->mode = DETECT_FULL;
+        } else if (detection == "cascade") {
+            s->mode = DETECT_CASCADE;
+        } else if (detection == "tiled") {
+            s->mode = DETECT_TILED;
+        } else {
+            cerr << "ERROR! Unknown detection mode: " << detection << "\n";
+            return -1;
+        }
 
-    // open mood model
-    posenet = readNet(posemodel, poseconfig);
-    posenet.setPreferableBackend(backendId);
-    posenet.setPreferableTarget(targetId);
+        // frames decoded by another process are read from shared memory
+        if (input.compare(0, 4, "shm:") == 0) {
+            s->shm.reset(new ShmRingReader());
+            s->shm->open(input.substr(4));
+        }
+        else if (input.size() == 1 && *(input.c_str()) >= '0' && *(input.c_str()) <= '9')
+            s->cap.open(std::stoi(input));
+        else
+            s->cap.open(input);
+
+        if (s->shm ? !s->shm->isOpened() : !s->cap.isOpened())
+        {
+            cerr << "ERROR! Unable to open video source\n";
+            return -1;
+        }
 
-    // open video capture source
-    if (input.size() == 1 && *(input.c_str()) >= '0' && *(input.c_str()) <= '9')
-        cap.open(std::stoi(input));
-    else
-        cap.open(input);
+        streams.push_back(move(s));
+    }
 
-    if (!cap.isOpened())
-    {
-        cerr << "ERROR! Unable to open video source\n";
+    if (streams.empty()) {
+        cerr << "ERROR! No video source in " << conf_file << "\n";
         return -1;
     }
 
-    // Also adjust delay so video playback matches the number of FPS in the file
-    double fps = cap.get(CAP_PROP_FPS);
-    delay = 1000 / fps;
+    String tracePath = parser.get<String>("trace");
+    if (!tracePath.empty()) {
+        trace_start(65536);
+        trace_thread_name("capture");
+    }
+
+    if (parser.has("bench")) {
+        int rtn = benchmark(*streams[0], workers);
+        saveTrace(tracePath);
+
+        return rtn;
+    }
+
+    // Also adjust delay so video playback matches the number of FPS in the file.
+    // A shared memory ring is paced by its producer.
+    if (streams[0]->shm) {
+        delay = 1;
+    } else {
+        double fps = streams[0]->cap.get(CAP_PROP_FPS);
+        delay = 1000 / fps;
+    }
 
     // register SIGTERM signal handler
     signal(SIGTERM, handle_sigterm);
 
     // start worker threads
+    pool.reset(new WorkPool(workers));
     thread t1(frameRunner);
     thread t2(messageRunner);
 
     // read video input data
-    for (;;) {
-        cap.read(frame);
+    while (keepRunning.load()) {
+        for (auto& s : streams) {
+            int64_t captureStart = trace_enabled() ? trace_now() : 0;
+            Mat frame;
+            TimePoint captured;
+            uint64_t seq;
+            if (!readFrame(*s, frame, captured, seq)) {
+                keepRunning = false;
+                cerr << "ERROR! blank frame grabbed\n";
+                break;
+            }
 
-        if (frame.empty()) {
-            keepRunning = false;
-            cerr << "ERROR! blank frame grabbed\n";
-            break;
-        }
+            // no new frame from the producer yet
+            if (frame.empty()) {
+                continue;
+            }
 
-        addImage(frame);
+            long frameId = addImage(*s, frame, captured, seq);
+            if (trace_enabled()) {
+                trace_event("capture", s->id, frameId, captureStart, trace_now());
+            }
 
-        string label = getCurrentPerf();
-        putText(frame, label, Point(0, 15), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 255, 255));
+            TraceScope scope("display", s->id, frameId);
 
-        WorkerInfo info = getCurrentInfo();
-        label = format("Watching: %d, Angry: %d", info.watching, info.angry);
-        putText(frame, label, Point(0, 40), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 255, 255));
+            // draw on a copy: the frame itself may still be under inference, or be
+            // a read-only view of shared memory
+            Mat display = frame.clone();
 
-        if (!info.watching) {
-            string warning;
-            warning = format("Operator not watching machine: PAUSE MACHINE");
-            putText(frame, warning, Point(0, 80), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0), 2);
-        }
+            string label = getCurrentPerf();
+            putText(display, label, Point(0, 15), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 255, 255));
+
+            WorkerInfo info = getCurrentInfo(*s);
+            label = format("Watching: %d, Angry: %d", info.watching, info.angry);
+            putText(display, label, Point(0, 40), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 255, 255));
+
+            Detection cost = getCurrentCost(*s);
+            long seen = 0, skipped = 0;
+            double skipRatio = getSkipRatio(*s, seen, skipped);
+            label = format("Face detection passes: %d, Frame inference time: %.2f ms, Skipped frames: %.0f%%", cost.passes, cost.ms, skipRatio * 100);
+            putText(display, label, Point(0, 60), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 255, 255));
 
-        if (info.alert) {
-            string warning;
-            warning = format("Operator angry at the machine: PAUSE MACHINE");
-            putText(frame, warning, Point(0, 80), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0), 2);
+            if (!info.watching) {
+                string warning;
+                warning = format("Operator not watching machine: PAUSE MACHINE");
+                putText(display, warning, Point(0, 80), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0), 2);
+            }
+
+            if (info.alert) {
+                string warning;
+                warning = format("Operator angry at the machine: PAUSE MACHINE");
+                putText(display, warning, Point(0, 80), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 0, 0), 2);
+            }
+
+            imshow(s->window, display);
         }
 
-        imshow("Machine Operator Monitor", frame);
+        int key;
+        {
+            TraceScope scope("waitKey");
+            key = waitKey(delay);
+        }
 
-        if (waitKey(delay) >= 0 || sig_caught) {
+        if (key >= 0 || sig_caught) {
             cout << "Attempting to stop background threads" << endl;
             keepRunning = false;
             break;
@@ -504,6 +1214,7 @@ int main(int argc, char** argv)
     mqtt_disconnect();
     mqtt_close();
 
+    saveTrace(tracePath);
+
     return 0;
 }
-
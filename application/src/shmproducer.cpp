@@ -0,0 +1,145 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+// shmproducer decodes a video file or camera and publishes its frames into a
+// shared memory ring, the way an external recorder feeds the monitor.
+
+// std includes
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <string>
+
+// OpenCV includes
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+// shared memory frame ring
+#include "shmring.h"
+
+using namespace std;
+using namespace cv;
+
+// flag to handle UNIX signals
+static volatile sig_atomic_t sig_caught = 0;
+
+const char* keys =
+    "{ help  h     | | Print help message. }"
+    "{ @input      | 0 | video file, or camera device number. }"
+    "{ @name       | monitor | name of the shared memory ring. }"
+    "{ slots s     | 8 | number of frames kept in the ring. }"
+    "{ loop l      |   | restart a video file when it ends. }";
+
+// signal handler for the main thread
+void handle_signal(int signum)
+{
+    sig_caught = 1;
+}
+
+int main(int argc, char** argv)
+{
+    // parse command parameters
+    CommandLineParser parser(argc, argv, keys);
+    parser.about("Use this tool to feed video frames to the monitor through shared memory.");
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+
+        return 0;
+    }
+
+    string input = parser.get<String>("@input");
+    string name = parser.get<String>("@name");
+    int slots = parser.get<int>("slots");
+    bool loop = parser.has("loop");
+
+    // open video capture source
+    VideoCapture cap;
+    bool camera = input.size() == 1 && *(input.c_str()) >= '0' && *(input.c_str()) <= '9';
+    if (camera)
+        cap.open(std::stoi(input));
+    else
+        cap.open(input);
+
+    if (!cap.isOpened())
+    {
+        cerr << "ERROR! Unable to open video source\n";
+        return -1;
+    }
+
+    double fps = cap.get(CAP_PROP_FPS);
+
+    Mat frame;
+    cap.read(frame);
+    if (frame.empty())
+    {
+        cerr << "ERROR! blank frame grabbed\n";
+        return -1;
+    }
+
+    ShmRingWriter ring;
+    if (!ring.create(name, frame.cols, frame.rows, frame.type(), slots, fps))
+    {
+        cerr << "ERROR! Unable to create shared memory ring " << name << "\n";
+        return -1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    cout << "Publishing " << frame.cols << "x" << frame.rows << " frames to " << name << endl;
+
+    // a camera delivers frames at its own pace, a file is played back at its frame rate
+    auto period = chrono::duration_cast<chrono::steady_clock::duration>(
+        chrono::duration<double>(fps > 0 ? 1 / fps : 0));
+    auto next = chrono::steady_clock::now();
+    long count = 0;
+    while (!sig_caught) {
+        if (!ring.write(frame)) {
+            cerr << "ERROR! frame size changed\n";
+            break;
+        }
+        count++;
+
+        if (!camera) {
+            next += period;
+            this_thread::sleep_until(next);
+        }
+
+        cap.read(frame);
+        if (frame.empty() && loop && !camera) {
+            cap.open(input);
+            cap.read(frame);
+        }
+
+        if (frame.empty()) {
+            break;
+        }
+    }
+
+    ring.close();
+    cout << "Published " << count << " frames" << endl;
+
+    return 0;
+}
@@ -0,0 +1,334 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "shmring.h"
+
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// shm_name returns the name of the shared memory object, which must start with a slash
+static std::string shm_name(const std::string& name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+static size_t round_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// futex_word returns the address of the futex word, as the futex syscall wants it.
+// The ring is mapped by several processes, so private futexes can not be used.
+static uint32_t* futex_word(ShmRingHeader* header)
+{
+    return reinterpret_cast<uint32_t*>(&header->notify);
+}
+
+ShmRingWriter::ShmRingWriter() : header(nullptr), size(0)
+{
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    close();
+}
+
+// create sets up a ring of slots frames of the given size and type, replacing
+// any ring left behind under the same name.
+bool ShmRingWriter::create(const std::string& name, int width, int height, int type, int slots, double fps)
+{
+    if (header != nullptr || width <= 0 || height <= 0 || slots <= 0 || type != CV_8UC3)
+    {
+        return false;
+    }
+
+    size_t stride = width * CV_ELEM_SIZE(type);
+    size_t slot_size = round_up(round_up(sizeof(ShmSlotHeader), 64) + stride * height, 4096);
+    size_t data_offset = round_up(sizeof(ShmRingHeader), 4096);
+    size_t total = data_offset + slot_size * slots;
+
+    this->name = shm_name(name);
+    shm_unlink(this->name.c_str());
+    int fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    if (ftruncate(fd, total) != 0)
+    {
+        ::close(fd);
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+
+    void* addr = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+
+    // the object is zero-filled by ftruncate, so the atomics start out at 0
+    header = static_cast<ShmRingHeader*>(addr);
+    size = total;
+    header->version = SHMRING_VERSION;
+    header->slots = slots;
+    header->width = width;
+    header->height = height;
+    header->type = type;
+    header->stride = stride;
+    header->fps_milli = fps > 0 ? uint32_t(fps * 1000) : 0;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+
+    // readers check the magic last, once the rest of the header is set
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHMRING_MAGIC;
+
+    return true;
+}
+
+// write copies a frame into the next slot of the ring and wakes up the readers
+bool ShmRingWriter::write(const cv::Mat& frame)
+{
+    if (header == nullptr || frame.cols != int(header->width) || frame.rows != int(header->height) ||
+        frame.type() != int(header->type))
+    {
+        return false;
+    }
+
+    uint64_t seq = header->written.load(std::memory_order_relaxed) + 1;
+    char* base = reinterpret_cast<char*>(header) + header->data_offset;
+    char* slot_addr = base + ((seq - 1) % header->slots) * header->slot_size;
+    ShmSlotHeader* slot = reinterpret_cast<ShmSlotHeader*>(slot_addr);
+    char* pixels = slot_addr + round_up(sizeof(ShmSlotHeader), 64);
+
+    slot->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (uint32_t row = 0; row < header->height; row++)
+    {
+        std::memcpy(pixels + row * header->stride, frame.ptr(row), header->stride);
+    }
+    slot->timestamp_ns = monotonic_ns();
+
+    slot->seq.store(seq, std::memory_order_release);
+    header->written.store(seq, std::memory_order_release);
+
+    header->notify.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, futex_word(header), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+
+    return true;
+}
+
+// close tells the readers that no more frames will come, and removes the ring
+void ShmRingWriter::close()
+{
+    if (header == nullptr)
+    {
+        return;
+    }
+
+    header->closed.store(1, std::memory_order_release);
+    header->notify.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, futex_word(header), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+
+    munmap(header, size);
+    shm_unlink(name.c_str());
+    header = nullptr;
+}
+
+ShmRingReader::ShmRingReader() : header(nullptr), size(0), last(0)
+{
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    if (header != nullptr)
+    {
+        munmap(header, size);
+    }
+}
+
+// open maps an existing ring read-only
+// valid_layout tells if the header describes BGR frames whose slots all fit in an
+// object of the given size. The header comes from another process, so the sizes are
+// checked without letting them overflow.
+static bool valid_layout(const ShmRingHeader& h, uint64_t size)
+{
+    if (h.slots == 0 || h.width == 0 || h.height == 0 || h.type != CV_8UC3 ||
+        h.stride < uint64_t(h.width) * CV_ELEM_SIZE(CV_8UC3))
+    {
+        return false;
+    }
+
+    uint64_t frame = round_up(sizeof(ShmSlotHeader), 64) + uint64_t(h.stride) * h.height;
+    if (h.slot_size < frame || h.data_offset < sizeof(ShmRingHeader) || h.data_offset > size)
+    {
+        return false;
+    }
+
+    return h.slots <= (size - h.data_offset) / h.slot_size;
+}
+
+bool ShmRingReader::open(const std::string& name)
+{
+    if (header != nullptr)
+    {
+        return false;
+    }
+
+    int fd = shm_open(shm_name(name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ShmRingHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+
+    ShmRingHeader* h = static_cast<ShmRingHeader*>(addr);
+    bool ok = h->magic == SHMRING_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ok = ok && h->version == SHMRING_VERSION && valid_layout(*h, st.st_size);
+    if (!ok)
+    {
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    header = h;
+    size = st.st_size;
+    last = header->written.load(std::memory_order_acquire);
+
+    return true;
+}
+
+bool ShmRingReader::isOpened() const
+{
+    return header != nullptr;
+}
+
+// read waits up to timeoutMs for a frame newer than the last one read, and sets
+// frame to a read-only view of the newest frame in the ring, and timestamp_ns to
+// its CLOCK_MONOTONIC capture time. Frames the reader fell behind on are skipped.
+// frame is left empty on timeout, and false is returned once the producer has
+// closed the ring.
+bool ShmRingReader::read(cv::Mat& frame, uint64_t& seq, uint64_t& timestamp_ns, int timeoutMs)
+{
+    frame = cv::Mat();
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t notify = header->notify.load(std::memory_order_acquire);
+    uint64_t written = header->written.load(std::memory_order_acquire);
+    if (written == last)
+    {
+        if (header->closed.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        struct timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        syscall(SYS_futex, futex_word(header), FUTEX_WAIT, notify, &timeout, nullptr, 0);
+
+        written = header->written.load(std::memory_order_acquire);
+        if (written == last)
+        {
+            return !header->closed.load(std::memory_order_acquire);
+        }
+    }
+
+    ShmSlotHeader* s = slot(written);
+    if (s->seq.load(std::memory_order_acquire) != written)
+    {
+        // the producer already moved on to this slot again
+        return true;
+    }
+
+    uint64_t timestamp = s->timestamp_ns;
+    if (!valid(written))
+    {
+        return true;
+    }
+
+    last = written;
+    seq = written;
+    timestamp_ns = timestamp;
+    char* pixels = reinterpret_cast<char*>(s) + round_up(sizeof(ShmSlotHeader), 64);
+    frame = cv::Mat(header->height, header->width, header->type, pixels, header->stride);
+
+    return true;
+}
+
+// valid tells if the frame read as seq is still in the ring, i.e. the producer
+// has not started to overwrite its slot. The fence keeps the reads of the slot
+// made before the call from moving past the check, matching the release fence
+// of the writer.
+bool ShmRingReader::valid(uint64_t seq) const
+{
+    if (header == nullptr)
+    {
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    return slot(seq)->seq.load(std::memory_order_relaxed) == seq;
+}
+
+ShmSlotHeader* ShmRingReader::slot(uint64_t seq) const
+{
+    char* base = reinterpret_cast<char*>(header) + header->data_offset;
+    return reinterpret_cast<ShmSlotHeader*>(base + ((seq - 1) % header->slots) * header->slot_size);
+}
@@ -0,0 +1,221 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> trace_on(false);
+
+struct TraceEvent
+{
+    const char* name;
+    int stream;
+    long frame;
+    int64_t start;
+    int64_t end;
+    bool wait;
+};
+
+// TraceBuffer is the ring buffer of one thread. Only its thread writes to it;
+// it is read once all the threads are done.
+struct TraceBuffer
+{
+    int tid;
+    std::string name;
+    std::vector<TraceEvent> events;
+    size_t count;
+};
+
+static std::mutex trace_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+static size_t trace_capacity = 0;
+
+// trace_buffer returns the buffer of the calling thread, registering it on first use.
+// The registry owns the buffers, so they outlive the threads that filled them.
+static TraceBuffer* trace_buffer()
+{
+    static thread_local TraceBuffer* buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        std::unique_ptr<TraceBuffer> b(new TraceBuffer());
+        b->tid = trace_buffers.size() + 1;
+        b->events.resize(trace_capacity);
+        b->count = 0;
+        buffer = b.get();
+        trace_buffers.push_back(std::move(b));
+    }
+
+    return buffer;
+}
+
+// trace_start turns recording on, keeping the last eventsPerThread events of every thread
+void trace_start(size_t eventsPerThread)
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_capacity = eventsPerThread > 0 ? eventsPerThread : 1;
+    trace_on = true;
+}
+
+// trace_thread_name names the calling thread in the trace
+void trace_thread_name(const char* name)
+{
+    if (!trace_enabled())
+    {
+        return;
+    }
+
+    TraceBuffer* b = trace_buffer();
+    if (b->name.empty())
+    {
+        b->name = name;
+    }
+}
+
+static void trace_record(const char* name, int stream, long frame, int64_t start, int64_t end, bool wait)
+{
+    if (!trace_enabled())
+    {
+        return;
+    }
+
+    TraceBuffer* b = trace_buffer();
+    TraceEvent& e = b->events[b->count % b->events.size()];
+    e.name = name;
+    e.stream = stream;
+    e.frame = frame;
+    e.start = start;
+    e.end = end;
+    e.wait = wait;
+    b->count++;
+}
+
+// trace_event records an event of the calling thread. name must be a string literal.
+void trace_event(const char* name, int stream, long frame, int64_t start, int64_t end)
+{
+    trace_record(name, stream, frame, start, end, false);
+}
+
+// trace_wait records the time a frame spent waiting before the calling thread took it.
+// The wait started on another thread, so it would not nest with the events of the
+// calling thread: it is exported as an async event of the frame instead.
+void trace_wait(const char* name, int stream, long frame, int64_t start, int64_t end)
+{
+    trace_record(name, stream, frame, start, end, true);
+}
+
+// trace_args writes the stream and frame of an event as its arguments
+static void trace_args(std::ostream& out, const TraceEvent& e)
+{
+    if (e.stream >= 0 || e.frame >= 0)
+    {
+        out << ", \"args\": {";
+        if (e.stream >= 0)
+        {
+            out << "\"stream\": " << e.stream << (e.frame >= 0 ? ", " : "");
+        }
+        if (e.frame >= 0)
+        {
+            out << "\"frame\": " << e.frame;
+        }
+        out << "}";
+    }
+}
+
+// trace_write stops recording and writes the events of all the threads to path as
+// Chrome trace JSON. It must only be called once the traced threads have stopped.
+bool trace_write(const std::string& path)
+{
+    trace_on = false;
+
+    std::ofstream out(path);
+    if (!out)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+
+    // times are exported in microseconds from the first event
+    int64_t origin = INT64_MAX;
+    for (auto const& b : trace_buffers)
+    {
+        size_t n = std::min(b->count, b->events.size());
+        for (size_t i = 0; i < n; i++)
+        {
+            origin = std::min(origin, b->events[i].start);
+        }
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (auto const& b : trace_buffers)
+    {
+        if (!b->name.empty())
+        {
+            out << (first ? "" : ",\n");
+            out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+                << ", \"args\": {\"name\": \"" << b->name << "\"}}";
+            first = false;
+        }
+
+        // oldest event first
+        size_t n = std::min(b->count, b->events.size());
+        for (size_t i = b->count - n; i < b->count; i++)
+        {
+            const TraceEvent& e = b->events[i % b->events.size()];
+            out << (first ? "" : ",\n");
+            if (e.wait)
+            {
+                // a begin and end pair, matched by the id of the frame
+                out << "{\"name\": \"" << e.name << "\", \"cat\": \"wait\", \"ph\": \"b\", \"id\": \"" << e.stream
+                    << "." << e.frame << "\", \"pid\": 1, \"tid\": " << b->tid
+                    << ", \"ts\": " << (e.start - origin) / 1000.0;
+                trace_args(out, e);
+                out << "},\n";
+                out << "{\"name\": \"" << e.name << "\", \"cat\": \"wait\", \"ph\": \"e\", \"id\": \"" << e.stream
+                    << "." << e.frame << "\", \"pid\": 1, \"tid\": " << b->tid
+                    << ", \"ts\": " << (e.end - origin) / 1000.0 << "}";
+            }
+            else
+            {
+                out << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid
+                    << ", \"ts\": " << (e.start - origin) / 1000.0
+                    << ", \"dur\": " << (e.end - e.start) / 1000.0;
+                trace_args(out, e);
+                out << "}";
+            }
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+
+    return out.good();
+}
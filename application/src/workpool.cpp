@@ -0,0 +1,211 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "workpool.h"
+
+WorkPool::WorkPool(size_t workers) : next(0), queued(0), running(true)
+{
+    if (workers == 0)
+    {
+        workers = 1;
+    }
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        deques.push_back(std::unique_ptr<Deque>(new Deque()));
+    }
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        threads.push_back(std::thread(&WorkPool::loop, this, i));
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    stop();
+}
+
+// size returns the number of workers in the pool
+size_t WorkPool::size() const
+{
+    return deques.size();
+}
+
+// submit queues a task from outside the pool. Tasks are spread round-robin over
+// the worker deques and rebalanced by stealing.
+void WorkPool::submit(Task task)
+{
+    push(next.fetch_add(1) % deques.size(), std::move(task));
+}
+
+// Batch holds the tasks of one call to run. Tasks are taken from the batch
+// itself, so whoever runs a batch only ever runs tasks of that batch.
+struct Batch
+{
+    std::mutex m;
+    std::condition_variable done;
+    std::deque<Task> tasks;
+    size_t remaining;
+};
+
+// take_task takes the next task of the batch, if any is left
+static bool take_task(Batch& batch, Task& task)
+{
+    std::lock_guard<std::mutex> lock(batch.m);
+    if (batch.tasks.empty())
+    {
+        return false;
+    }
+
+    task = std::move(batch.tasks.front());
+    batch.tasks.pop_front();
+
+    return true;
+}
+
+// finish_task counts a task of the batch as done
+static void finish_task(Batch& batch)
+{
+    std::lock_guard<std::mutex> lock(batch.m);
+    if (--batch.remaining == 0)
+    {
+        batch.done.notify_all();
+    }
+}
+
+// run executes tasks in parallel from inside the pool and returns once all of
+// them have finished. Idle workers may steal tasks of the batch, while the
+// calling worker runs the rest of the batch itself, never unrelated queued work,
+// and then sleeps until the stolen tasks are done.
+void WorkPool::run(std::vector<Task>& tasks, size_t worker)
+{
+    if (tasks.empty())
+    {
+        return;
+    }
+
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = tasks.size();
+    for (auto& t : tasks)
+    {
+        batch->tasks.push_back(std::move(t));
+    }
+
+    // one stealable slot per task; a slot left once the batch is empty does nothing
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        push(worker, [batch](size_t w) {
+            Task task;
+            if (take_task(*batch, task))
+            {
+                task(w);
+                finish_task(*batch);
+            }
+        });
+    }
+
+    Task task;
+    while (take_task(*batch, task))
+    {
+        task(worker);
+        finish_task(*batch);
+    }
+
+    std::unique_lock<std::mutex> lock(batch->m);
+    batch->done.wait(lock, [&batch] { return batch->remaining == 0; });
+}
+
+// stop wakes all the workers and waits for them to exit. Queued tasks that
+// have not started yet are dropped.
+void WorkPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (!running.load())
+        {
+            return;
+        }
+        running = false;
+    }
+    cv.notify_all();
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    threads.clear();
+}
+
+void WorkPool::push(size_t worker, Task task)
+{
+    // count the task before it becomes visible, so that a thief can never take
+    // it before it is counted, and under the pool lock so that a worker can not
+    // miss the wakeup between checking queued and going to sleep
+    {
+        std::lock_guard<std::mutex> lock(m);
+        queued++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(deques[worker]->m);
+        deques[worker]->tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+// pop takes the oldest task of the worker's own deque, or steals the oldest
+// task of another worker when its own deque is empty.
+bool WorkPool::pop(size_t worker, Task& task)
+{
+    for (size_t i = 0; i < deques.size(); i++)
+    {
+        Deque& d = *deques[(worker + i) % deques.size()];
+        std::lock_guard<std::mutex> lock(d.m);
+        if (!d.tasks.empty())
+        {
+            task = std::move(d.tasks.front());
+            d.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkPool::loop(size_t worker)
+{
+    while (running.load())
+    {
+        Task task;
+        if (pop(worker, task))
+        {
+            task(worker);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [this] { return queued.load() > 0 || !running.load(); });
+    }
+}